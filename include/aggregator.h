@@ -0,0 +1,213 @@
+#ifndef __AGGREGATOR_H_
+#define __AGGREGATOR_H_
+
+#include <sys/types.h>
+#include <mutex>
+#include <vector>
+#include "common.h"
+#include "bucket.h"
+
+__SHM_STL_BEGIN
+
+// The combiner of counting workloads, it adds a delta to the old value
+template <typename _Value>
+struct Sum {
+    void operator() (_Value &old_value, const _Value &delta) {
+        old_value += delta;
+    }
+};
+
+/*
+ * @brief : Aggregator lets many threads combine values into one shared hash_table,
+ *          for example to count keys in a group-by.
+ *
+ *          Every thread updates its own Local table with _Modifier as the
+ *          combiner, so hot keys are combined without any lock. A Local table is
+ *          merged into the shared table under the aggregator lock when it holds
+ *          flush_threshold keys, when Flush is called, and when it is destroyed.
+ *          If another thread is merging at that moment, the Local table keeps
+ *          combining and tries again later, it only waits for the lock when it
+ *          grows to HARD_LIMIT_FACTOR times the threshold. A merge ends with an
+ *          O(1) Clear of the Local table.
+ *
+ *          Nothing is dropped when the shared table is full. The entries which do
+ *          not fit stay in the Local table, Update returns UPDATE_SHARED_FULL and
+ *          Flush and Merge return false. Only the entries left when a Local table
+ *          is destroyed, or a delta which fits in neither table, are lost, and
+ *          Update returns UPDATE_DROPPED for such a delta.
+ *
+ *          While an aggregator is in use, the shared table must only be reached
+ *          through the aggregator.
+ *
+ *          Following is a chart to illustrate this class:
+ *
+ *          thread 1 --> Local [k1, k2, ...] --+
+ *          thread 2 --> Local [k1, k3, ...] --+--> [lock] --> shared table
+ *          thread 3 --> Local [k2, k3, ...] --+
+ *
+ * */
+template <typename _Table, typename _Modifier = Sum<typename _Table::value_type> >
+class Aggregator {
+    public:
+        typedef _Table table_type;
+        typedef typename _Table::key_type key_type;
+        typedef typename _Table::value_type value_type;
+        typedef typename _Table::allocator_type allocator_type;
+
+        static const uint32 DEFAULT_FLUSH_THRESHOLD = 1024;
+        static const uint32 HARD_LIMIT_FACTOR = 4;
+
+        // The result of Local::Update
+        enum UpdateResult {
+            UPDATE_OK,          // the delta is combined
+            UPDATE_SHARED_FULL, // the delta is kept, but a merge left entries which did not fit
+            UPDATE_DROPPED      // the delta fits in neither table and is lost
+        };
+
+        // Local tables take their memory from alloc
+        Aggregator(table_type & shared, uint32 flush_threshold = DEFAULT_FLUSH_THRESHOLD,
+                   const allocator_type & alloc = allocator_type()) :
+                   m_shared(shared), m_flush_threshold(flush_threshold ? flush_threshold : 1), m_alloc(alloc) {}
+
+        // The private table of one thread, it must not be shared between threads
+        class Local {
+            public:
+                Local(Aggregator & aggregator) : m_aggregator(aggregator),
+                                                 m_table(aggregator.m_flush_threshold, aggregator.m_flush_threshold,
+                                                         aggregator.m_alloc) {}
+
+                ~Local() {Flush();}
+
+                /*
+                 * @brief
+                 *  Combine delta into key. UPDATE_SHARED_FULL tells the caller to back
+                 *  off: the delta is kept, but a merge found the shared table full
+                 *  and the entries which did not fit wait in this table.
+                 * */
+                UpdateResult Update(const key_type & key, const value_type & delta) {
+                    if (!Combine(m_table, key, delta, m_modifier)) {
+                        // This table is full, make room and try again
+                        bool flushed = Flush();
+                        if (!Combine(m_table, key, delta, m_modifier))
+                            return UPDATE_DROPPED;
+
+                        if (!flushed)
+                            return UPDATE_SHARED_FULL;
+                    }
+
+                    uint32 size = m_table.Size();
+                    if (size >= m_aggregator.m_flush_threshold) {
+                        if (size >= m_aggregator.m_flush_threshold * HARD_LIMIT_FACTOR)
+                            return m_aggregator.Merge(m_table) ? UPDATE_OK : UPDATE_SHARED_FULL;
+
+                        return m_aggregator.TryMerge(m_table);
+                    }
+
+                    return UPDATE_OK;
+                }
+
+                // Merge everything combined so far into the shared table
+                bool Flush(void) {
+                    if (m_table.Size() == 0)
+                        return true;
+
+                    return m_aggregator.Merge(m_table);
+                }
+
+                uint32 Size(void) const {return m_table.Size();}
+
+            private:
+                // Not copyable, it belongs to one thread
+                Local(const Local &);
+                Local & operator= (const Local &);
+
+            private:
+                Aggregator &m_aggregator;
+                table_type  m_table;
+                _Modifier   m_modifier;
+        };
+
+        /*
+         * @brief
+         *  Merge a table into the shared table, it waits for the lock. The merged
+         *  entries leave the table. It returns false if some entries did not fit
+         *  in the shared table, they are left in the table.
+         * */
+        bool Merge(table_type & local) {
+            std::lock_guard<std::mutex> guard(m_lock);
+            return MergeLocked(local);
+        }
+
+        // Find a key in the shared table, values still in Local tables are not seen
+        bool Find(const key_type & key, value_type * ret = NULL) {
+            std::lock_guard<std::mutex> guard(m_lock);
+            return m_shared.Find(key, ret);
+        }
+
+        // Call action(key, value) for every entry in the shared table
+        template <typename _Action>
+        void ForEach(_Action & action) {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_shared.ForEach(action);
+        }
+
+    private:
+        // Not copyable, Local tables refer to it
+        Aggregator(const Aggregator &);
+        Aggregator & operator= (const Aggregator &);
+
+        // Combine delta into the value of key, or insert it if key is new
+        static bool Combine(table_type & table, const key_type & key, const value_type & delta, _Modifier & modifier) {
+            if (table.Update(key, delta, modifier))
+                return true;
+
+            return table.Insert(key, delta);
+        }
+
+        struct MergeAction {
+            MergeAction(table_type & target) : m_target(target) {}
+
+            void operator() (const key_type & key, const value_type & value) {
+                if (!Combine(m_target, key, value, m_modifier)) {
+                    m_left_keys.push_back(key);
+                    m_left_values.push_back(value);
+                }
+            }
+
+            table_type             &m_target;
+            _Modifier               m_modifier;
+            std::vector<key_type>   m_left_keys;   // the entries which did not fit
+            std::vector<value_type> m_left_values;
+        };
+
+        // Merge like Merge unless the lock is busy, then the table keeps combining
+        UpdateResult TryMerge(table_type & local) {
+            std::unique_lock<std::mutex> guard(m_lock, std::try_to_lock);
+            if (!guard.owns_lock())
+                return UPDATE_OK;
+
+            return MergeLocked(local) ? UPDATE_OK : UPDATE_SHARED_FULL;
+        }
+
+        bool MergeLocked(table_type & local) {
+            MergeAction action(m_shared);
+            local.ForEach(action);
+            local.Clear();
+
+            // Put back what did not fit, the table held it just now so it fits again
+            for (size_t i = 0; i < action.m_left_keys.size(); ++i)
+                local.Insert(action.m_left_keys[i], action.m_left_values[i]);
+
+            return action.m_left_keys.empty();
+        }
+
+    private:
+        table_type &m_shared;
+        uint32      m_flush_threshold;
+        allocator_type m_alloc;
+        std::mutex  m_lock; // guards m_shared
+};
+
+__SHM_STL_END
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __ALLOCATOR_H_
+#define __ALLOCATOR_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "shm_stl_config.h"
+
+__SHM_STL_BEGIN
+
+/*
+ * @brief : Arena hands out memory from big blocks and never frees a single
+ *          allocation. All blocks are freed at once by Release or when the arena
+ *          is destroyed. Each block is twice the size of the previous one.
+ *
+ *          Following is a chart to illustrate this class:
+ *
+ *          m_blocks --> +-----------------+     +---------------------------------+
+ *                       | next |  used... | --> | next |  used ...  |    free    |
+ *                       +-----------------+     +---------------------------------+
+ *                                                                    ^
+ *                                                                    m_cursor
+ * */
+class Arena {
+    public:
+        static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+        Arena(size_t block_size = DEFAULT_BLOCK_SIZE) : m_blocks(NULL), m_cursor(NULL), m_end(NULL),
+                                                        m_next_block_size(block_size), m_allocated(0) {}
+
+        ~Arena() {Release();}
+
+        void * Allocate(size_t size, size_t alignment) {
+            char * start = AlignUp(m_cursor, alignment);
+            if (m_cursor == NULL || start + size > m_end) {
+                if (!NewBlock(size + alignment))
+                    return NULL;
+                start = AlignUp(m_cursor, alignment);
+            }
+
+            m_cursor = start + size;
+            m_allocated += size;
+            return start;
+        }
+
+        // Free all blocks at once, nothing allocated before can be used anymore
+        void Release(void) {
+            while (m_blocks) {
+                Block * next = m_blocks->m_next;
+                free(m_blocks);
+                m_blocks = next;
+            }
+
+            m_cursor = NULL;
+            m_end = NULL;
+            m_allocated = 0;
+        }
+
+        size_t Allocated(void) const {return m_allocated;}
+
+    private:
+        struct Block {
+            Block * m_next;
+        };
+
+        // Not copyable, it owns its blocks
+        Arena(const Arena &);
+        Arena & operator= (const Arena &);
+
+        static char * AlignUp(char * p, size_t alignment) {
+            return reinterpret_cast<char *>((reinterpret_cast<size_t>(p) + alignment - 1) & ~(alignment - 1));
+        }
+
+        bool NewBlock(size_t min_size) {
+            size_t size = m_next_block_size;
+            while (size < min_size + sizeof(Block))
+                size <<= 1;
+
+            Block * block = static_cast<Block *>(malloc(size));
+            if (block == NULL)
+                return false;
+
+            block->m_next = m_blocks;
+            m_blocks = block;
+            m_cursor = reinterpret_cast<char *>(block + 1);
+            m_end = reinterpret_cast<char *>(block) + size;
+            m_next_block_size = size << 1;
+            return true;
+        }
+
+    private:
+        Block *m_blocks;          // the newest block, blocks are chained from it
+        char  *m_cursor;          // the first free byte in the newest block
+        char  *m_end;             // the end of the newest block
+        size_t m_next_block_size; // the size of next block
+        size_t m_allocated;       // the bytes handed out
+};
+
+/*
+ * @brief : MonotonicBuffer hands out memory from a buffer owned by the caller, for
+ *          example one on the stack of a request handler. It never frees a single
+ *          allocation and returns NULL once the buffer is exhausted. Reset makes
+ *          the whole buffer available again.
+ * */
+class MonotonicBuffer {
+    public:
+        MonotonicBuffer(void * buffer, size_t size) : m_begin(static_cast<char *>(buffer)),
+                                                      m_cursor(static_cast<char *>(buffer)),
+                                                      m_end(static_cast<char *>(buffer) + size) {}
+
+        void * Allocate(size_t size, size_t alignment) {
+            char * start = reinterpret_cast<char *>((reinterpret_cast<size_t>(m_cursor) + alignment - 1) & ~(alignment - 1));
+            if (start + size > m_end)
+                return NULL;
+
+            m_cursor = start + size;
+            return start;
+        }
+
+        // Reuse the buffer from the start, nothing allocated before can be used anymore
+        void Reset(void) {m_cursor = m_begin;}
+
+        size_t Used(void) const {return m_cursor - m_begin;}
+        size_t Available(void) const {return m_end - m_cursor;}
+
+    private:
+        char *m_begin;
+        char *m_cursor;
+        char *m_end;
+};
+
+/*
+ * @brief : ResourceAllocator is a standard allocator which takes memory from an
+ *          Arena or a MonotonicBuffer. deallocate does nothing, the memory goes
+ *          back when the resource is released. Pass it to hash_table to put a
+ *          table into an arena:
+ *
+ *          Arena arena;
+ *          hash_table<int, int, hash<int>, std::equal_to<int>, ResourceAllocator<char, Arena> >
+ *              table(4096, 512, ResourceAllocator<char, Arena>(arena));
+ * */
+template <typename _Tp, typename _Resource>
+class ResourceAllocator {
+    public:
+        typedef _Tp value_type;
+
+        template <typename _Up>
+        struct rebind {
+            typedef ResourceAllocator<_Up, _Resource> other;
+        };
+
+        ResourceAllocator(_Resource & resource) : m_resource(&resource) {}
+
+        template <typename _Up>
+        ResourceAllocator(const ResourceAllocator<_Up, _Resource> & other) : m_resource(other.Resource()) {}
+
+        _Tp * allocate(size_t n) {
+            return static_cast<_Tp *>(m_resource->Allocate(n * sizeof(_Tp), alignof(_Tp)));
+        }
+
+        void deallocate(_Tp *, size_t) {}
+
+        _Resource * Resource(void) const {return m_resource;}
+
+        template <typename _Up>
+        bool operator== (const ResourceAllocator<_Up, _Resource> & other) const {
+            return m_resource == other.Resource();
+        }
+
+        template <typename _Up>
+        bool operator!= (const ResourceAllocator<_Up, _Resource> & other) const {
+            return m_resource != other.Resource();
+        }
+
+    private:
+        _Resource *m_resource;
+};
+
+__SHM_STL_END
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <sys/types.h>
 #include <memory.h>
+#include <memory>
+#include <type_traits>
 #include <iostream>
 #include <sstream>
 #include "common.h"
@@ -17,6 +19,34 @@ const u_int32_t DEFAULT_BUCKET_NUM = 512;
 typedef u_int32_t sig_t;
 typedef u_int32_t uint32;
 typedef int32_t   int32;
+typedef u_int64_t uint64;
+
+/*
+ * @brief : Counters of the bucket filters, collected by hash_table lookups
+ *          m_lookups         - lookups which reached a bucket
+ *          m_filtered        - lookups rejected by the filter without touching a node
+ *          m_false_positives - lookups let through by the filter which found nothing
+ * */
+struct FilterStats {
+    FilterStats() : m_lookups(0), m_filtered(0), m_false_positives(0) {}
+
+    // The share of misses the filter failed to reject
+    double FalsePositiveRate(void) const {
+        uint64 misses = m_filtered + m_false_positives;
+        return misses ? double(m_false_positives) / misses : 0;
+    }
+
+    void Str(ostream &os) const {
+        os << "** Filter Lookups         : " << m_lookups << std::endl;
+        os << "** Filter Rejected        : " << m_filtered << std::endl;
+        os << "** Filter False Positives : " << m_false_positives << std::endl;
+        os << "** Filter FP Rate         : " << FalsePositiveRate() << std::endl;
+    }
+
+    uint64 m_lookups;
+    uint64 m_filtered;
+    uint64 m_false_positives;
+};
 
 template <typename _Node>
 struct PrintNode {
@@ -28,39 +58,80 @@ struct PrintNode {
 template <typename _Node, typename _Key, typename _KeyEqual>
 class Bucket {
     public:
-        Bucket () : m_size(0), m_head(NULL) {}
-        ~Bucket () {Clear();}
+        Bucket () : m_size(0), m_epoch(0), m_cow_version(0), m_filter(0), m_head(NULL), m_tail(NULL),
+                    m_filter_stale(false) {}
 
         void Clear(void) {
             m_size = 0;
+            m_filter = 0;
+            m_filter_stale = false;
             m_head = NULL;
+            m_tail = NULL;
         }
 
         // Put a node at the head of this bucket
         void Put(_Node * node) {
             node->SetNext(m_head);
             m_head = node;
+            if (m_tail == NULL)
+                m_tail = node;
+            m_filter |= FilterBit(node->Signature());
             ++m_size;
         }
 
-        // Lookup a node by signature and key
-        _Node * Lookup(const sig_t &sig, const _Key &key) {
+        // False means no node of this signature is in this bucket
+        bool MayContain(const sig_t &sig) const {
+            return (m_filter & FilterBit(sig)) != 0;
+        }
+
+        /*
+         * Lookup a node by signature and key, the filter is counted in stats if
+         * it is given. A miss walks the whole chain, so it also rebuilds a filter
+         * left stale by Remove.
+         * */
+        template <typename _K>
+        _Node * Lookup(const sig_t &sig, const _K &key, FilterStats * stats = NULL) {
+            if (stats)
+                ++stats->m_lookups;
+
+            if (!MayContain(sig)) {
+                if (stats)
+                    ++stats->m_filtered;
+                return NULL;
+            }
+
             // Search in this bucket
+            uint64 filter = 0;
             _Node * current = m_head;
             _Node * prev = current;
             while (current) {
-                if (sig == current->Signature() && m_equal_to(key, current->Key())) {
+                if (current->MatchSignature(sig) && m_equal_to(key, current->Key())) {
                     break;
                 }
 
+                if (m_filter_stale)
+                    filter |= FilterBit(current->Signature());
+
                 prev = current;
                 current = current->Next();
             }
 
+            if (current == NULL) {
+                if (stats)
+                    ++stats->m_false_positives;
+
+                if (m_filter_stale) {
+                    m_filter = filter;
+                    m_filter_stale = false;
+                }
+            }
+
             // If we find this key in bucket, move it to the front of bucket
             if (current != NULL) {
                 if (current != m_head) {
                     prev->SetNext(current->Next());
+                    if (current == m_tail)
+                        m_tail = prev;
                     current->SetNext(m_head);
                     m_head = current;
                 }
@@ -75,16 +146,45 @@ class Bucket {
             return current;
         }
 
+        // Search a node by signature and key without reordering this bucket
+        template <typename _K>
+        _Node * Search(const sig_t &sig, const _K &key) const {
+            if (!MayContain(sig))
+                return NULL;
+
+            _Node * current = m_head;
+            while (current) {
+                if (current->MatchSignature(sig) && m_equal_to(key, current->Key()))
+                    return current;
+
+                current = current->Next();
+            }
+
+            return NULL;
+        }
+
         // Remove a node from this bucket
-        _Node * Remove(const sig_t &sig, const _Key &key) {
+        template <typename _K>
+        _Node * Remove(const sig_t &sig, const _K &key) {
             _Node * node = Lookup(sig, key);
 
             // If we find this node, now it is in the front of our node list,
             // we just remove it from the head
             if (node) {
                 m_head = node->Next();
+                if (m_head == NULL)
+                    m_tail = NULL;
                 node->SetNext(NULL);
                 --m_size;
+
+                // Other nodes may share the bit of this node, so it is left set
+                // and the filter is rebuilt by the next miss, see Lookup
+                if (m_head == NULL) {
+                    m_filter = 0;
+                    m_filter_stale = false;
+                } else {
+                    m_filter_stale = true;
+                }
             }
 
             return node;
@@ -92,21 +192,20 @@ class Bucket {
 
         uint32  Size(void) const {return m_size;}
         _Node * Head(void) const {return m_head;}
-        _Node * Tail(void) const {
-            if (m_head == NULL)
-                return NULL;
+        _Node * Tail(void) const {return m_tail;}
 
-            _Node * current = m_head;
-            while (current->Next()) {
-                current = current->Next();
-            }
+        // The epoch in which this bucket was last written. A bucket whose epoch
+        // differs from the table epoch is logically empty, see hash_table::Clear
+        uint32  Epoch(void) const {return m_epoch;}
+        void    SetEpoch(uint32 epoch) {m_epoch = epoch;}
 
-            // If we find a node whose next is NULL, it is the tail of this bucket
-            return current;
-        }
+        // The snapshot version this bucket was last copied for, see hash_table::Snapshot
+        uint32  CowVersion(void) const {return m_cow_version;}
+        void    SetCowVersion(uint32 version) {m_cow_version = version;}
 
         void Str(ostream &os) {
             os << "\nBucket Size : " << m_size << std::endl;
+            os << "Bucket Filter : 0x" << std::hex << m_filter << std::dec << std::endl;
             _Node * curr = m_head;
             while (curr) {
                 curr->Str(os);
@@ -114,24 +213,47 @@ class Bucket {
             }
         }
 
+    private:
+        /*
+         * One bit of the 64-bit filter per signature. The signature is mixed first,
+         * so the bit comes from the high bits as well as the bits in the bucket mask,
+         * which keeps the filter useful for identity hashes of small integers.
+         * */
+        static uint64 FilterBit(const sig_t &sig) {
+            return 1ULL << ((sig * 0x9E3779B1u) >> 26);
+        }
+
     public:
-        uint32 m_size; // the size of this bucket
-        _Node *m_head; // the pointer of the first node in this bucket
+        uint32 m_size;  // the size of this bucket
+        uint32 m_epoch; // the table epoch this bucket belongs to
+        uint32 m_cow_version; // the latest snapshot which has a copy of this bucket
+        uint64 m_filter; // one bit set for the signature of each node, see FilterBit
+        _Node *m_head;  // the pointer of the first node in this bucket
+        _Node *m_tail;  // the pointer of the last node in this bucket
+        bool   m_filter_stale; // m_filter may have bits of removed nodes
         _KeyEqual m_equal_to;
 }; 
 
-template <typename _Bucket>
+template <typename _Bucket, typename _Alloc = std::allocator<_Bucket> >
 class BucketMgr {
     public:
         typedef _Bucket bucket_t;
+        typedef typename std::allocator_traits<_Alloc>::template rebind_alloc<_Bucket> allocator_type;
+        typedef std::allocator_traits<allocator_type> alloc_traits;
 
-        BucketMgr(uint32 size) : m_size(size), m_mask(0), m_bucket_array(NULL) {
+        BucketMgr(uint32 size, const allocator_type & alloc = allocator_type()) :
+                  m_size(size), m_mask(0), m_epoch(0), m_bucket_array(NULL), m_alloc(alloc) {
             Initialize();
         }
 
         ~BucketMgr(void) {
-            if (m_bucket_array)
-                delete [] m_bucket_array;
+            if (m_bucket_array) {
+                if (!std::is_trivially_destructible<bucket_t>::value) {
+                    for (uint32 i = 0; i < m_size; ++i)
+                        alloc_traits::destroy(m_alloc, &m_bucket_array[i]);
+                }
+                alloc_traits::deallocate(m_alloc, m_bucket_array, m_size);
+            }
             
             m_size = 0;
             m_mask = 0;
@@ -148,10 +270,27 @@ class BucketMgr {
             return GetBucketByIndex(sig & m_mask);
         }
 
+        inline uint32 IndexOf(const bucket_t * bucket) const {
+            return bucket - m_bucket_array;
+        }
+
         inline uint32 Size(void) const {
             return m_size;
         }
 
+        // Buckets stamped with an older epoch are treated as empty
+        inline uint32 Epoch(void) const {
+            return m_epoch;
+        }
+
+        inline uint32 NextEpoch(void) {
+            return ++m_epoch;
+        }
+
+        inline bool IsStale(const bucket_t * bucket) const {
+            return bucket->Epoch() != m_epoch;
+        }
+
         inline void Str(ostream &os) const {
             os << "** Total Buckets : " << m_size << std::endl;
             os << "** Bucket Mask   : 0x" << std::hex << m_mask << std::dec << std::endl;
@@ -159,7 +298,10 @@ class BucketMgr {
             for (int i = 0; i < m_size; ++i) {
                 os << std::endl;
                 os << "Bucket[" << i << "]" << std::endl;
-                m_bucket_array[i].Str(os); 
+                if (IsStale(&m_bucket_array[i]))
+                    os << "\nBucket Size : 0 (stale)" << std::endl;
+                else
+                    m_bucket_array[i].Str(os); 
             }
         }
 
@@ -172,15 +314,26 @@ class BucketMgr {
             m_mask = m_size - 1;
 
             // Allocate memory for bucket 
-            m_bucket_array = new bucket_t[m_size];
-            if (m_bucket_array == NULL)
+            m_bucket_array = alloc_traits::allocate(m_alloc, m_size);
+            if (m_bucket_array == NULL) {
+                // No bucket can be found from now on
+                m_size = 0;
+                m_mask = 0;
                 return false;
+            }
+
+            for (uint32 i = 0; i < m_size; ++i)
+                alloc_traits::construct(m_alloc, &m_bucket_array[i]);
+
+            return true;
         }
 
     private:
         uint32    m_size;
         uint32    m_mask;
+        uint32    m_epoch; // the current epoch, bumped by every hash_table::Clear
         bucket_t *m_bucket_array;
+        allocator_type m_alloc;
 };
 
 __SHM_STL_END
@@ -0,0 +1,486 @@
+#ifndef __FROZEN_TABLE_H_
+#define __FROZEN_TABLE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <memory.h>
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include "hash_fun.h"
+#include "common.h"
+#include "bucket.h"
+
+using std::ostream;
+
+__SHM_STL_BEGIN
+
+typedef u_int16_t uint16;
+
+/*
+ * @brief : The layout of a frozen table, both in memory and in a file. It is
+ *          followed by the pilot array, the remap array and the entry array.
+ *          All offsets are counted from the start of this header.
+ * */
+struct FrozenHeader {
+    char   m_magic[8];
+    uint32 m_version;
+    uint32 m_key_size;
+    uint32 m_value_size;
+    uint32 m_entry_size;
+    uint32 m_size;    // the count of entries
+    uint32 m_slots;   // the count of slots the perfect hash maps to, m_slots >= m_size
+    uint32 m_groups;  // the count of pilots
+    uint32 m_reserved;
+    uint64 m_seed;
+    uint64 m_pilot_offset;
+    uint64 m_remap_offset;
+    uint64 m_entry_offset;
+    uint64 m_total_size;
+};
+
+static const char   FROZEN_MAGIC[8] = {'S', 'H', 'M', 'F', 'R', 'O', 'Z', 'N'};
+static const uint32 FROZEN_VERSION  = 1;
+
+/*
+ * @brief : FrozenTable is an immutable table indexed by a minimal perfect hash. It
+ *          is built by hash_table::Freeze for tables which are only read after
+ *          they are filled.
+ *
+ *          The perfect hash follows PTHash. Keys are spread into groups of about
+ *          LAMBDA keys each. Every group gets a 16-bit pilot, found at build time,
+ *          which sends all keys of that group to distinct free slots. There are a
+ *          few more slots than keys to make pilots easy to find. The few keys
+ *          which land on a slot beyond the last entry are remapped to the holes
+ *          left below it. So a lookup reads one pilot and one entry, and the
+ *          perfect hash costs about 4 bits per key.
+ *
+ *          Keys and values are packed together in one flat array, the whole table
+ *          lives in one block of memory which can be saved to a file and mapped
+ *          back by Load. This is why keys and values must be trivially copyable.
+ *
+ *          Following is a chart to illustrate a lookup:
+ *
+ *          key --> hash --> group --> m_pilots[group] --> slot --> m_entries[slot]
+ *                                                          |          ^
+ *                                                          |          | [slot >= size]
+ *                                                          +--> m_remap[slot - size]
+ *
+ * */
+template <typename _Key, typename _Value, typename _HashFunc = hash<_Key>, typename _EqualKey = std::equal_to<_Key> >
+class FrozenTable {
+    public:
+        typedef _Key key_type;
+        typedef _Value value_type;
+        typedef _HashFunc hasher;
+        typedef _EqualKey key_equal;
+
+        struct Entry {
+            _Key   m_key;
+            _Value m_value;
+        };
+
+        static const uint32 LAMBDA = 5;              // the average count of keys in a group
+        static const uint32 MAX_PILOT = 0xFFFF;      // pilots are stored in 16 bits
+        static const uint32 MAX_BUILD_ATTEMPTS = 16; // the count of seeds tried before giving up
+
+        FrozenTable() : m_header(NULL), m_pilots(NULL), m_remap(NULL), m_entries(NULL),
+                        m_buffer(NULL), m_mapping(NULL), m_mapping_size(0) {}
+
+        ~FrozenTable() {Release();}
+
+        uint32 Size(void) const {return m_header ? m_header->m_size : 0;}
+
+        /*
+         * @brief
+         *  Build this table from n keys and their values, any content before is
+         *  dropped. It returns false if two keys have the same hash value, or
+         *  if no perfect hash can be found.
+         * */
+        bool Build(const key_type * keys, const value_type * values, uint32 n) {
+            Release();
+
+            uint32 groups = n / LAMBDA + 1;
+            uint32 slots  = n + n / 32 + 1;
+
+            std::vector<uint64> hashes(n);
+            for (uint32 i = 0; i < n; ++i)
+                hashes[i] = m_hash_func(keys[i]);
+
+            std::vector<uint16> pilots(groups);
+            for (uint32 attempt = 0; attempt < MAX_BUILD_ATTEMPTS; ++attempt) {
+                uint64 seed = Mix(attempt + 0x9E3779B97F4A7C15ULL);
+                int ret = Search(hashes, seed, groups, slots, pilots);
+                if (ret < 0)
+                    return false;
+
+                if (ret > 0) {
+                    Fill(keys, values, hashes, seed, groups, slots, pilots);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /*
+         * @brief
+         *  key is an input parameter for lookup
+         *  ret is an output parameter to take the value if the key is in this table
+         * */
+        bool Find(const key_type & key, value_type * ret = NULL) const {
+            if (m_header == NULL || m_header->m_size == 0)
+                return false;
+
+            const Entry & entry = m_entries[Slot(Mix(uint64(m_hash_func(key)) ^ m_header->m_seed))];
+            if (!m_equal_to(key, entry.m_key))
+                return false;
+
+            if (ret)
+                *ret = entry.m_value;
+            return true;
+        }
+
+        // Save this table to a file which can be mapped by Load
+        bool Save(const char * path) const {
+            if (m_header == NULL)
+                return false;
+
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                return false;
+
+            const char * data = reinterpret_cast<const char *>(m_header);
+            uint64 left = m_header->m_total_size;
+            while (left > 0) {
+                ssize_t n = write(fd, data, left);
+                if (n <= 0) {
+                    close(fd);
+                    return false;
+                }
+                data += n;
+                left -= n;
+            }
+
+            return close(fd) == 0;
+        }
+
+        // Map a file written by Save, the table reads the file in place
+        bool Load(const char * path) {
+            Release();
+
+            int fd = open(path, O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FrozenHeader)) {
+                close(fd);
+                return false;
+            }
+
+            void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (mapping == MAP_FAILED)
+                return false;
+
+            m_mapping = mapping;
+            m_mapping_size = st.st_size;
+            if (!Attach(static_cast<char *>(mapping), st.st_size) || !CheckRemap()) {
+                Release();
+                return false;
+            }
+
+            return true;
+        }
+
+        void Str(ostream & os) const {
+            os << "\nFrozen Table Information : " << std::endl;
+            if (m_header == NULL) {
+                os << "** Empty" << std::endl;
+                return;
+            }
+
+            uint32 size = m_header->m_size;
+            uint64 index_bits = uint64(m_header->m_groups) * 16 + uint64(m_header->m_slots - size) * 32;
+            os << "** Entries       : " << size << std::endl;
+            os << "** Slots         : " << m_header->m_slots << std::endl;
+            os << "** Groups        : " << m_header->m_groups << std::endl;
+            os << "** Bits Per Key  : " << (size ? double(index_bits) / size : 0) << std::endl;
+            os << "** Memory Mapped : " << (m_mapping ? "yes" : "no") << std::endl;
+        }
+
+    private:
+        // Not copyable, it owns its memory
+        FrozenTable(const FrozenTable &);
+        FrozenTable & operator= (const FrozenTable &);
+
+        // The finalizer of MurmurHash3, it is a bijection
+        static uint64 Mix(uint64 x) {
+            x ^= x >> 33;
+            x *= 0xFF51AFD7ED558CCDULL;
+            x ^= x >> 33;
+            x *= 0xC4CEB9FE1A85EC53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+        // Map x to [0, range) without a division
+        static uint32 FastRange(uint32 x, uint32 range) {
+            return uint32((uint64(x) * range) >> 32);
+        }
+
+        static uint32 Group(uint64 hash, uint32 groups) {
+            return FastRange(uint32(hash), groups);
+        }
+
+        // The multiply makes the high bits depend on every bit of the pilot hash
+        static uint32 Position(uint64 hash, uint32 pilot, uint32 slots) {
+            return FastRange(uint32(((hash ^ Mix(pilot + 1)) * 0x9E3779B97F4A7C15ULL) >> 32), slots);
+        }
+
+        uint32 Slot(uint64 hash) const {
+            uint32 pos = Position(hash, m_pilots[Group(hash, m_header->m_groups)], m_header->m_slots);
+            if (pos >= m_header->m_size)
+                pos = m_remap[pos - m_header->m_size];
+            return pos;
+        }
+
+        /*
+         * @brief
+         *  Find a pilot for every group with this seed. Groups are placed from the
+         *  biggest one, while the slots are still mostly free.
+         *  It returns 1 on success, 0 if this seed does not work and -1 if two
+         *  keys have the same hash value so that no seed can work.
+         * */
+        static int Search(const std::vector<uint64> & hashes, uint64 seed, uint32 groups,
+                          uint32 slots, std::vector<uint16> & pilots) {
+            uint32 n = hashes.size();
+
+            // Sort keys by group
+            std::vector<uint64> keyed(n);
+            std::vector<uint32> start(groups + 1, 0);
+            for (uint32 i = 0; i < n; ++i) {
+                keyed[i] = Mix(hashes[i] ^ seed);
+                ++start[Group(keyed[i], groups) + 1];
+            }
+
+            uint32 max_group_size = 0;
+            for (uint32 g = 0; g < groups; ++g) {
+                if (start[g + 1] > max_group_size)
+                    max_group_size = start[g + 1];
+                start[g + 1] += start[g];
+            }
+
+            std::vector<uint64> sorted(n);
+            std::vector<uint32> fill(start.begin(), start.end() - 1);
+            for (uint32 i = 0; i < n; ++i)
+                sorted[fill[Group(keyed[i], groups)]++] = keyed[i];
+
+            // Order groups by size, the biggest first
+            std::vector<uint32> by_size_start(max_group_size + 2, 0);
+            for (uint32 g = 0; g < groups; ++g)
+                ++by_size_start[max_group_size - (start[g + 1] - start[g]) + 1];
+            for (uint32 s = 0; s <= max_group_size; ++s)
+                by_size_start[s + 1] += by_size_start[s];
+
+            std::vector<uint32> order(groups);
+            for (uint32 g = 0; g < groups; ++g)
+                order[by_size_start[max_group_size - (start[g + 1] - start[g])]++] = g;
+
+            std::vector<bool> taken(slots, false);
+            std::vector<uint32> positions(max_group_size);
+            for (uint32 i = 0; i < groups; ++i) {
+                uint32 g = order[i];
+                uint32 first = start[g];
+                uint32 size  = start[g + 1] - first;
+                if (size == 0) {
+                    pilots[g] = 0;
+                    continue;
+                }
+
+                // Two equal hash values can never be told apart
+                for (uint32 a = first; a < first + size; ++a)
+                    for (uint32 b = a + 1; b < first + size; ++b)
+                        if (sorted[a] == sorted[b])
+                            return -1;
+
+                uint32 pilot = 0;
+                for ( ; pilot <= MAX_PILOT; ++pilot) {
+                    uint32 k = 0;
+                    for ( ; k < size; ++k) {
+                        uint32 pos = Position(sorted[first + k], pilot, slots);
+                        if (taken[pos])
+                            break;
+
+                        uint32 j = 0;
+                        while (j < k && positions[j] != pos)
+                            ++j;
+                        if (j < k)
+                            break;
+
+                        positions[k] = pos;
+                    }
+
+                    if (k == size)
+                        break;
+                }
+
+                if (pilot > MAX_PILOT)
+                    return 0;
+
+                pilots[g] = pilot;
+                for (uint32 k = 0; k < size; ++k)
+                    taken[positions[k]] = true;
+            }
+
+            return 1;
+        }
+
+        // Lay out the table in one block and put every entry in its slot
+        void Fill(const key_type * keys, const value_type * values, const std::vector<uint64> & hashes,
+                  uint64 seed, uint32 groups, uint32 slots, const std::vector<uint16> & pilots) {
+            uint32 n = hashes.size();
+
+            FrozenHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.m_magic, FROZEN_MAGIC, sizeof(header.m_magic));
+            header.m_version      = FROZEN_VERSION;
+            header.m_key_size     = sizeof(_Key);
+            header.m_value_size   = sizeof(_Value);
+            header.m_entry_size   = sizeof(Entry);
+            header.m_size         = n;
+            header.m_slots        = slots;
+            header.m_groups       = groups;
+            header.m_seed         = seed;
+            header.m_pilot_offset = Align(sizeof(FrozenHeader), sizeof(uint16));
+            header.m_remap_offset = Align(header.m_pilot_offset + uint64(groups) * sizeof(uint16), sizeof(uint32));
+            header.m_entry_offset = Align(header.m_remap_offset + uint64(slots - n) * sizeof(uint32), alignof(Entry));
+            header.m_total_size   = header.m_entry_offset + uint64(n) * sizeof(Entry);
+
+            m_buffer = new char[header.m_total_size];
+            memset(m_buffer, 0, header.m_total_size);
+            memcpy(m_buffer, &header, sizeof(header));
+            Attach(m_buffer, header.m_total_size);
+
+            uint16 * pilot_array = const_cast<uint16 *>(m_pilots);
+            uint32 * remap_array = const_cast<uint32 *>(m_remap);
+            Entry  * entry_array = const_cast<Entry *>(m_entries);
+            memcpy(pilot_array, &pilots[0], groups * sizeof(uint16));
+
+            // Slots beyond the last entry are sent to the holes below it
+            std::vector<bool> taken(slots, false);
+            for (uint32 i = 0; i < n; ++i) {
+                uint64 hash = Mix(hashes[i] ^ seed);
+                taken[Position(hash, pilots[Group(hash, groups)], slots)] = true;
+            }
+
+            uint32 hole = 0;
+            for (uint32 pos = n; pos < slots; ++pos) {
+                if (!taken[pos])
+                    continue;
+
+                while (taken[hole])
+                    ++hole;
+                remap_array[pos - n] = hole++;
+            }
+
+            for (uint32 i = 0; i < n; ++i) {
+                Entry & entry = entry_array[Slot(Mix(hashes[i] ^ seed))];
+                entry.m_key   = keys[i];
+                entry.m_value = values[i];
+            }
+        }
+
+        static uint64 Align(uint64 offset, uint64 alignment) {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+
+        // Check a block laid out by Fill and point the arrays into it
+        bool Attach(char * base, uint64 size) {
+            const FrozenHeader * header = reinterpret_cast<const FrozenHeader *>(base);
+            if (memcmp(header->m_magic, FROZEN_MAGIC, sizeof(FROZEN_MAGIC)) != 0 ||
+                header->m_version != FROZEN_VERSION ||
+                header->m_key_size != sizeof(_Key) ||
+                header->m_value_size != sizeof(_Value) ||
+                header->m_entry_size != sizeof(Entry) ||
+                header->m_total_size > size ||
+                header->m_slots < header->m_size ||
+                header->m_groups == 0)
+                return false;
+
+            // The arrays follow the header in order, each aligned and inside the block
+            if (header->m_pilot_offset < sizeof(FrozenHeader) ||
+                header->m_pilot_offset > header->m_total_size ||
+                header->m_remap_offset > header->m_total_size ||
+                header->m_entry_offset > header->m_total_size ||
+                header->m_pilot_offset % alignof(uint16) != 0 ||
+                header->m_remap_offset % alignof(uint32) != 0 ||
+                header->m_entry_offset % alignof(Entry) != 0 ||
+                header->m_pilot_offset + uint64(header->m_groups) * sizeof(uint16) > header->m_remap_offset ||
+                header->m_remap_offset + uint64(header->m_slots - header->m_size) * sizeof(uint32) > header->m_entry_offset ||
+                header->m_entry_offset + uint64(header->m_size) * sizeof(Entry) > header->m_total_size)
+                return false;
+
+            m_header  = header;
+            m_pilots  = reinterpret_cast<const uint16 *>(base + header->m_pilot_offset);
+            m_remap   = reinterpret_cast<const uint32 *>(base + header->m_remap_offset);
+            m_entries = reinterpret_cast<const Entry *>(base + header->m_entry_offset);
+            return true;
+        }
+
+        // Every remapped slot must be an entry, a lookup trusts it without a check
+        bool CheckRemap(void) const {
+            uint32 remapped = m_header->m_slots - m_header->m_size;
+            if (m_header->m_size == 0)
+                return true;
+
+            for (uint32 i = 0; i < remapped; ++i) {
+                if (m_remap[i] >= m_header->m_size)
+                    return false;
+            }
+
+            return true;
+        }
+
+        void Release(void) {
+            if (m_buffer) {
+                delete [] m_buffer;
+                m_buffer = NULL;
+            }
+
+            if (m_mapping) {
+                munmap(m_mapping, m_mapping_size);
+                m_mapping = NULL;
+                m_mapping_size = 0;
+            }
+
+            m_header  = NULL;
+            m_pilots  = NULL;
+            m_remap   = NULL;
+            m_entries = NULL;
+        }
+
+    private:
+        static_assert(std::is_trivially_copyable<_Key>::value && std::is_trivially_copyable<_Value>::value,
+                      "FrozenTable keeps keys and values in flat, mappable memory");
+
+        const FrozenHeader *m_header;
+        const uint16       *m_pilots;  // one pilot per group
+        const uint32       *m_remap;   // the holes for slots beyond the last entry
+        const Entry        *m_entries; // the packed keys and values
+        char               *m_buffer;  // the block built by Build
+        void               *m_mapping; // the file mapped by Load
+        size_t              m_mapping_size;
+        hasher              m_hash_func;
+        key_equal           m_equal_to;
+};
+
+__SHM_STL_END
+
+#endif
@@ -32,6 +32,9 @@
 #define __SHM_STL_HASH_FUN_H
 
 #include <stddef.h>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include "shm_stl_config.h"
 
 __SHM_STL_BEGIN
@@ -85,6 +88,66 @@ __SHM_STL_TEMPLATE_NULL struct hash<unsigned long> {
   size_t operator()(unsigned long __x) const { return __x; }
 };
 
+/*
+ * recomputable_hash<_HashFunc, _Key>::value is true when the hash of a key is so
+ * cheap that hash_table nodes need not store it. The hashes of integers above
+ * are the integers themselves.
+ */
+template <class _HashFunc, class _Key>
+struct recomputable_hash : std::false_type { };
+
+template <class _Key>
+struct recomputable_hash<hash<_Key>, _Key> : std::is_integral<_Key> { };
+
+/*
+ * Transparent lookup: a hasher or a key equal functor which declares
+ *   typedef void is_transparent;
+ * accepts any type comparable to the key, and must give that type the same
+ * hash value as the equal key. hash_table only looks up by other types when
+ * both of its functors are transparent.
+ */
+template <class _Tp, class = void>
+struct is_transparent : std::false_type { };
+
+template <class _Tp>
+struct is_transparent<_Tp, typename std::conditional<true, void, typename _Tp::is_transparent>::type>
+  : std::true_type { };
+
+/*
+ * Lookup by _K in a table of _Key is only offered if both functors are
+ * transparent and can take a _K, so a wrong type fails at the call site
+ * instead of deep inside a bucket.
+ */
+template <class _HashFunc, class _EqualKey, class _Key, class _K>
+struct transparent_lookup
+  : std::conjunction<is_transparent<_HashFunc>, is_transparent<_EqualKey>,
+                     std::is_invocable<const _HashFunc&, const _K&>,
+                     std::is_invocable_r<bool, const _EqualKey&, const _K&, const _Key&> > { };
+
+inline size_t __stl_hash_string(const char* __s, size_t __n)
+{
+  unsigned long __h = 0; 
+  for (size_t __i = 0; __i < __n; ++__i)
+    __h = 5*__h + __s[__i];
+  
+  return size_t(__h);
+}
+
+/* Hash std::string, string_view and C strings alike, as hash<const char*> does */
+struct string_hash
+{
+  typedef void is_transparent;
+
+  size_t operator()(std::string_view __s) const { return __stl_hash_string(__s.data(), __s.size()); }
+};
+
+struct string_equal_to
+{
+  typedef void is_transparent;
+
+  bool operator()(std::string_view __x, std::string_view __y) const { return __x == __y; }
+};
+
 __SHM_STL_END
 
 #endif /* __SGI_STL_HASH_FUN_H */
@@ -2,13 +2,25 @@
 #define __HASH_TABLE_H_
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <bits/stl_function.h>
 #include <memory.h>
+#include <memory>
+#include <type_traits>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include "hash_fun.h"
 #include "common.h"
 #include "bucket.h"
+#include "snapshot.h"
+#include "frozen_table.h"
+#include "allocator.h"
+#include "aggregator.h"
 
 using std::ostream;
     
@@ -23,15 +35,45 @@ struct Assignment {
 
 const u_int32_t DEFAULT_ENTRIES = 4096;
 
-template <typename _Key, typename _Value>
-class Node {
+/*
+ * @brief : NodeSignature keeps the signature of a node. When the hash of a key is
+ *          cheap to recompute (see recomputable_hash in hash_fun.h), nothing is
+ *          stored: the signature is recomputed from the key when it is asked for,
+ *          and lookups compare keys directly. This saves 4 bytes plus padding per
+ *          node for integer keys.
+ * */
+template <typename _Key, typename _HashFunc, bool _Stored = !recomputable_hash<_HashFunc, _Key>::value>
+class NodeSignature {
+    public:
+        NodeSignature () : m_sig(0) {}
+
+        void SetSignature(sig_t s) {m_sig = s;}
+        sig_t Signature(const _Key &) const {return m_sig;}
+        bool MatchSignature(const sig_t &sig) const {return sig == m_sig;}
+
+    private:
+        sig_t  m_sig;   // the sinature - hash value
+};
+
+template <typename _Key, typename _HashFunc>
+class NodeSignature<_Key, _HashFunc, false> {
     public:
-        Node () : m_sig(0), m_next(NULL) {}
+        void SetSignature(sig_t) {}
+        sig_t Signature(const _Key & key) const {return _HashFunc()(key);}
+        bool MatchSignature(const sig_t &) const {return true;}
+};
+
+template <typename _Key, typename _Value, typename _HashFunc = hash<_Key> >
+class Node : private NodeSignature<_Key, _HashFunc> {
+    public:
+        typedef NodeSignature<_Key, _HashFunc> signature_type;
+
+        Node () : m_next(NULL) {}
         
         void Fill(_Key k, _Value v, sig_t s) {
             m_key = k;
             m_value = v;
-            m_sig = s;
+            signature_type::SetSignature(s);
         }
 
         void SetNext(Node * next) {m_next = next;}
@@ -42,24 +84,30 @@ class Node {
             update(m_value, new_value);
         }
 
-        _Key Key(void) const {return m_key;}
+        const _Key & Key(void) const {return m_key;}
         _Value Value(void) const {return m_value;}
-        sig_t Signature(void) const {return m_sig;}
+        sig_t Signature(void) const {return signature_type::Signature(m_key);}
         Node * Next(void) const {return m_next;}
         uint32 Index(void) const {return m_index;}
 
+        // False means this node can not hold a key of this signature
+        bool MatchSignature(const sig_t &sig) const {return signature_type::MatchSignature(sig);}
+
         void Str(ostream &os) {
-            os << "[ <" << m_key << ", " << m_value << ">, " << m_sig << " ] --> " << std::endl; 
+            os << "[ <" << m_key << ", " << m_value << ">, " << Signature() << " ] --> " << std::endl; 
         }
 
     private:
         _Key   m_key;
         _Value m_value;
-        sig_t  m_sig;   // the sinature - hash value
         Node * m_next;  // the pointer of next node
         uint32 m_index; // the index of this node in node list, it should never be changed after initialization
 };
 
+// std::hash is not recomputable_hash, so that node stores its signature
+static_assert(sizeof(Node<int, int>) < sizeof(Node<int, int, std::hash<int> >),
+              "Nodes of integer keys should not store their signatures");
+
 /*
  * @brief : FreeNodePool manages free nodes used by hashmap. A hashmap should always
  *          get a free node from FreeNodePool and return it back when it decides to
@@ -78,6 +126,17 @@ class Node {
  *          2. PutNode - Put a node to FreeNodePool
  *          3. PutNodeList - Put a list of nodes to FreeNodePool
  *
+ *          A pool can also grow ahead of time. Reserve grows it right away. After
+ *          StartPrefill, a background thread builds the next free list whenever
+ *          the free entries drop to a low watermark, and GetNode adopts it in
+ *          O(1) once it is ready, so an Insert never waits for a big list to be
+ *          allocated and linked. The allocator must then be usable from that
+ *          thread.
+ *
+ *          Free node lists are allocated by _Alloc. Nodes which are trivially
+ *          destructible are not destroyed one by one, so with an arena allocator
+ *          a whole pool goes away with the arena.
+ *
  *          Important:
  *          1. Programmers should not free any node outside of FreeNodePool
  *
@@ -100,27 +159,39 @@ class Node {
  *                                   |_______________|
  *
  * */
-template <typename _Node>
+template <typename _Node, typename _Alloc = std::allocator<_Node> >
 class NodePool {
     public:
         typedef _Node node_type;
+        typedef typename std::allocator_traits<_Alloc>::template rebind_alloc<_Node> allocator_type;
+        typedef std::allocator_traits<allocator_type> alloc_traits;
         static const uint32 MAX_RESIZE_COUNT = 5;
         static const uint32 DEFAULT_LIST_SIZE = 16;  // The default size of the first free list
 
-        NodePool(uint32 size) : m_capacity(0), m_free_entries(0), m_free_list_num(0), 
-                                m_next_free_list_size(size), m_node_pool_head(NULL) {
+        NodePool(uint32 size, const allocator_type & alloc = allocator_type()) :
+                                m_capacity(0), m_free_entries(0), m_free_list_num(0), 
+                                m_next_free_list_size(size), m_node_pool_head(NULL), m_alloc(alloc),
+                                m_low_watermark(0), m_prefill_pending(false), m_prefill(NULL) {
                                     // Initilize the m_free_list_array
                                     memset(&m_free_list_array[0], 0, sizeof(m_free_list_array));
+                                    memset(&m_free_list_size[0], 0, sizeof(m_free_list_size));
                                     
                                     // Create the first free list
                                     Resize();
                                 }
 
         ~NodePool() {
+            StopPrefill();
+
             for (int i = 0; i < m_free_list_num; ++i) {
                 node_type * node_list = m_free_list_array[i];
-                delete [] node_list;
+                if (!std::is_trivially_destructible<node_type>::value) {
+                    for (uint32 j = 0; j < m_free_list_size[i]; ++j)
+                        alloc_traits::destroy(m_alloc, &node_list[j]);
+                }
+                alloc_traits::deallocate(m_alloc, node_list, m_free_list_size[i]);
                 m_free_list_array[i] = NULL;
+                m_free_list_size[i] = 0;
             }
 
             m_capacity = 0;
@@ -133,8 +204,14 @@ class NodePool {
         uint32 Capacity(void) const {return m_capacity;}
         uint32 FreeEntries(void) const {return m_free_entries;}
 
+        // The free entries at which a new list is asked for, 0 without prefill
+        uint32 LowWatermark(void) const {return m_prefill ? m_low_watermark : 0;}
+
         // Get a free node
         node_type * GetNode(void) {
+            if (m_prefill && m_free_entries <= m_low_watermark)
+                CheckPrefill();
+
             if (m_node_pool_head == NULL)
                 Resize();
 
@@ -179,6 +256,53 @@ class NodePool {
         }
 
 
+        // Grow this pool until it has at least entries free nodes
+        bool Reserve(uint32 entries) {
+            while (m_free_entries < entries) {
+                uint32 capacity = m_capacity;
+                Resize();
+                if (m_capacity == capacity)
+                    return false;
+            }
+
+            return true;
+        }
+
+        /*
+         * @brief
+         *  Start a background thread which builds the next free list when the
+         *  free entries drop to low_watermark. Calling it again only changes
+         *  the low watermark.
+         * */
+        void StartPrefill(uint32 low_watermark) {
+            m_low_watermark = low_watermark;
+            if (m_prefill)
+                return;
+
+            m_prefill = new PrefillWorker();
+            m_prefill->m_thread = std::thread(&NodePool::PrefillLoop, this);
+        }
+
+        // Stop the background thread, a free list it has built is kept
+        void StopPrefill(void) {
+            if (m_prefill == NULL)
+                return;
+
+            {
+                std::lock_guard<std::mutex> guard(m_prefill->m_lock);
+                m_prefill->m_stop = true;
+            }
+            m_prefill->m_cond.notify_all();
+            m_prefill->m_thread.join();
+
+            if (m_prefill_pending && m_prefill->m_done.load(std::memory_order_acquire))
+                AdoptPrefill();
+
+            delete m_prefill;
+            m_prefill = NULL;
+            m_prefill_pending = false;
+        }
+
         void Print(void) {
             std::ostringstream os;
             Str(os);
@@ -196,22 +320,71 @@ class NodePool {
         }
 
     private:
+        // The state shared with the background thread, guarded by m_lock
+        struct PrefillWorker {
+            PrefillWorker() : m_request_size(0), m_index_start(0), m_stop(false),
+                              m_ready(NULL), m_ready_size(0), m_done(false) {}
+
+            std::thread             m_thread;
+            std::mutex              m_lock;
+            std::condition_variable m_cond;
+            uint32                  m_request_size; // the size of the list to build, 0 if none
+            uint32                  m_index_start;  // the index of the first node of that list
+            bool                    m_stop;
+            node_type              *m_ready;        // the list built, NULL if it failed
+            uint32                  m_ready_size;
+            std::atomic<bool>       m_done;         // m_ready is published
+        };
+
         // Create a new free node list and chain it to free node pool
         void Resize(void) {
+            // A list is being built in background, wait for it rather than build another
+            if (m_prefill_pending) {
+                {
+                    std::unique_lock<std::mutex> guard(m_prefill->m_lock);
+                    while (!m_prefill->m_done.load(std::memory_order_acquire))
+                        m_prefill->m_cond.wait(guard);
+                }
+                AdoptPrefill();
+                if (m_node_pool_head != NULL)
+                    return;
+            }
+
             // Have reached the maxinum size
             if (m_free_list_num >= MAX_RESIZE_COUNT)
                 return;
 
             // Create a new free list
             uint32 size = m_next_free_list_size;
-            node_type * new_list = new node_type[size];
+            node_type * new_list = NewList(size, m_capacity);
             if (new_list == NULL)
                 return;
 
-            // Now we have created the new free list successfully, add it to m_free_list_array
-            // and free node pool
-            InitializeFreeNodeList(new_list, size, m_capacity);
+            AddList(new_list, size);
+
+#ifdef DEBUG
+            std::cout << "Just Resize Node Pool! ...... " << std::endl;
+            Print();
+#endif
+        }
+
+        // Allocate a free list and link its nodes, every page of it is touched here
+        node_type * NewList(uint32 size, uint32 index_start) {
+            node_type * new_list = alloc_traits::allocate(m_alloc, size);
+            if (new_list == NULL)
+                return NULL;
+
+            for (uint32 i = 0; i < size; ++i)
+                alloc_traits::construct(m_alloc, &new_list[i]);
+
+            InitializeFreeNodeList(new_list, size, index_start);
+            return new_list;
+        }
+
+        // Add a free list built by NewList to m_free_list_array and free node pool
+        void AddList(node_type * new_list, uint32 size) {
             m_free_list_array[m_free_list_num] = new_list;
+            m_free_list_size[m_free_list_num] = size;
             node_type * end_of_list = &new_list[size - 1];
             PutNodeList(new_list, end_of_list, size); // PutNodeList will calculate m_free_entries
 
@@ -219,11 +392,66 @@ class NodePool {
             m_capacity += size;
             m_free_list_num++;
             m_next_free_list_size = size << 1;
+        }
 
-#ifdef DEBUG
-            std::cout << "Just Resize Node Pool! ...... " << std::endl;
-            Print();
-#endif
+        // Adopt the list built in background if it is ready, or ask for one
+        void CheckPrefill(void) {
+            if (m_prefill_pending) {
+                if (m_prefill->m_done.load(std::memory_order_acquire))
+                    AdoptPrefill();
+                return;
+            }
+
+            if (m_free_list_num >= MAX_RESIZE_COUNT)
+                return;
+
+            // No list can be added before this one is adopted, so its indexes start at m_capacity
+            {
+                std::lock_guard<std::mutex> guard(m_prefill->m_lock);
+                m_prefill->m_request_size = m_next_free_list_size;
+                m_prefill->m_index_start = m_capacity;
+                m_prefill->m_done.store(false, std::memory_order_relaxed);
+            }
+            m_prefill->m_cond.notify_all();
+            m_prefill_pending = true;
+        }
+
+        // Take the list published by the background thread, it must be done
+        void AdoptPrefill(void) {
+            node_type * new_list = m_prefill->m_ready;
+            uint32 size = m_prefill->m_ready_size;
+            m_prefill->m_ready = NULL;
+            m_prefill->m_done.store(false, std::memory_order_relaxed);
+            m_prefill_pending = false;
+
+            if (new_list)
+                AddList(new_list, size);
+        }
+
+        // The background thread, it builds one list per request
+        void PrefillLoop(void) {
+            PrefillWorker * worker = m_prefill;
+            std::unique_lock<std::mutex> guard(worker->m_lock);
+            while (true) {
+                while (!worker->m_stop && worker->m_request_size == 0)
+                    worker->m_cond.wait(guard);
+
+                if (worker->m_stop)
+                    return;
+
+                uint32 size = worker->m_request_size;
+                uint32 index_start = worker->m_index_start;
+                worker->m_request_size = 0;
+
+                guard.unlock();
+                node_type * new_list = NewList(size, index_start);
+                guard.lock();
+
+                worker->m_ready = new_list;
+                worker->m_ready_size = size;
+                worker->m_done.store(true, std::memory_order_release);
+                worker->m_cond.notify_all();
+            }
         }
 
         void InitializeFreeNodeList(node_type *list, uint32 size, uint32 index_start) {
@@ -251,30 +479,64 @@ class NodePool {
         uint32     m_next_free_list_size; // the size of next free list
         node_type *m_node_pool_head;      // the head of free node pool
         node_type *m_free_list_array[MAX_RESIZE_COUNT]; // free lists
+        uint32     m_free_list_size[MAX_RESIZE_COUNT];  // the size of each free list
+        allocator_type m_alloc;
+        uint32     m_low_watermark;       // ask for the next list at this many free entries
+        bool       m_prefill_pending;     // a list is asked for and not adopted yet
+        PrefillWorker *m_prefill;         // the background thread, NULL if not started
 };
 
-template <typename _Key, typename _Value, typename _HashFunc = hash<_Key>, typename _EqualKey = std::equal_to<_Key> >
+/*
+ * @brief : hash_table takes the memory of its nodes and buckets from _Alloc, which
+ *          is rebound to each of them. Any standard allocator works, including
+ *          std::pmr::polymorphic_allocator and ResourceAllocator over an Arena or
+ *          a MonotonicBuffer (see allocator.h).
+ * */
+template <typename _Key, typename _Value, typename _HashFunc = hash<_Key>, typename _EqualKey = std::equal_to<_Key>,
+          typename _Alloc = std::allocator<char> >
 class hash_table {
     public:
-        typedef Node<_Key, _Value> node_type;
+        typedef Node<_Key, _Value, _HashFunc> node_type;
         typedef _Key key_type;
         typedef _Value value_type;
         typedef _HashFunc hasher;
         typedef _EqualKey key_equal;
         typedef Bucket<node_type, key_type, key_equal>  bucket_type;
-        typedef NodePool<node_type> node_pool_type;
-        typedef BucketMgr<bucket_type> bucket_mgr;
+        typedef _Alloc allocator_type;
+        typedef NodePool<node_type, allocator_type> node_pool_type;
+        typedef BucketMgr<bucket_type, allocator_type> bucket_mgr;
+        typedef TableSnapshot<hash_table> snapshot_type;
+        typedef FrozenTable<_Key, _Value, _HashFunc, _EqualKey> frozen_type;
 
-    public:
-        hash_table(uint32 entries = DEFAULT_ENTRIES, uint32 buckets = DEFAULT_BUCKET_NUM) : 
-                   m_buckets(buckets), m_node_pool(entries) {}
+        static const uint32 INSERT_SWEEP_BUCKETS = 64; // the stale buckets an Insert sweeps ahead
 
-        ~hash_table(void) {}
+    public:
+        hash_table(uint32 entries = DEFAULT_ENTRIES, uint32 buckets = DEFAULT_BUCKET_NUM,
+                   const allocator_type & alloc = allocator_type()) : 
+                   m_buckets(buckets, alloc), m_node_pool(entries, alloc), m_entries(0),
+                   m_used_buckets(0), m_stale_buckets(0), m_sweep_cursor(0),
+                   m_snapshots(NULL), m_snap_version(0) {}
+
+        ~hash_table(void) {
+            // Snapshots should have been released, drop the ones left behind
+            while (m_snapshots)
+                ReleaseSnapshot(m_snapshots);
+        }
 
         bool Insert(const key_type & key, const value_type & value) {
             // Check if this key is already in hash table
             if (Find(key))
                 return false;
+
+            // Nodes of cleared buckets are still parked in their chains. Every
+            // insert sweeps a few buckets ahead, so they are mostly back before
+            // the node pool runs low, and it only sweeps on for the nodes it
+            // needs before the pool grows or asks for a prefill
+            if (m_stale_buckets > 0) {
+                Sweep(INSERT_SWEEP_BUCKETS);
+                if (m_node_pool.FreeEntries() <= m_node_pool.LowWatermark())
+                    ReclaimNodes(m_node_pool.LowWatermark() + 1);
+            }
                         
             // Get a new node from free list
             node_type * node = m_node_pool.GetNode();
@@ -286,8 +548,17 @@ class hash_table {
             node->Fill(key, value, sig);
 
             // Put node to bucket
-            bucket_type * bucket = m_buckets.GetBucketBySig(sig); 
+            bucket_type * bucket = GetBucket(sig); 
+            if (bucket == NULL) {
+                m_node_pool.PutNode(node);
+                return false;
+            }
+
+            CopyOnWrite(bucket);
+            if (bucket->Size() == 0)
+                ++m_used_buckets;
             bucket->Put(node);
+            ++m_entries;
 
 #ifdef DEBUG
             m_node_pool.Print();
@@ -304,6 +575,218 @@ class hash_table {
          *  ret is an output parameter to take the value if the key is in the hash table
          * */
         bool Find(const key_type & key, value_type * ret = NULL) {
+            return FindKey(key, ret);
+        }
+
+        bool Erase(const key_type &key, value_type * ret = NULL) {
+            return EraseKey(key, ret);
+        }
+
+        // Update the value
+        template <typename _Modifier>
+        bool Update(const key_type & key, value_type new_value, _Modifier &update) {
+            return UpdateKey(key, new_value, update);
+        }
+
+        /*
+         * @brief
+         *  Find, Erase and Update by any type comparable to key_type, such as a
+         *  string_view for string keys, without building a key_type first. They
+         *  are only there if both hasher and key_equal are transparent and take a
+         *  _K, see transparent_lookup in hash_fun.h.
+         * */
+        template <typename _K>
+        typename std::enable_if<transparent_lookup<hasher, key_equal, key_type, _K>::value, bool>::type
+        Find(const _K & key, value_type * ret = NULL) {
+            return FindKey(key, ret);
+        }
+
+        template <typename _K>
+        typename std::enable_if<transparent_lookup<hasher, key_equal, key_type, _K>::value, bool>::type
+        Erase(const _K & key, value_type * ret = NULL) {
+            return EraseKey(key, ret);
+        }
+
+        template <typename _K, typename _Modifier>
+        typename std::enable_if<transparent_lookup<hasher, key_equal, key_type, _K>::value, bool>::type
+        Update(const _K & key, value_type new_value, _Modifier &update) {
+            return UpdateKey(key, new_value, update);
+        }
+
+        /*
+         * @brief
+         *  Clear this hash table in O(1). The bucket epoch is bumped so that every
+         *  bucket written before is treated as empty. Their nodes are given back to
+         *  the node pool lazily: when the bucket is touched again, a few at a time
+         *  by each Insert, or by Sweep.
+         * */
+        void Clear(void) {
+            // Make sure no stale bucket survives an epoch wrap around, this is
+            // the only full sweep and it comes once every 2^32 Clears
+            if (m_buckets.Epoch() == UINT32_MAX && m_stale_buckets > 0)
+                Sweep(m_buckets.Size());
+
+            m_stale_buckets += m_used_buckets;
+            m_used_buckets = 0;
+            m_entries = 0;
+            m_sweep_cursor = 0;
+            m_buckets.NextEpoch();
+#ifdef DEBUG
+            m_node_pool.Print();
+#endif
+        }
+
+        /*
+         * @brief
+         *  Reclaim stale buckets left behind by Clear. At most max_buckets buckets
+         *  are visited, so the owner can spread the work over idle time.
+         *  It returns how many buckets are reclaimed.
+         * */
+        uint32 Sweep(uint32 max_buckets) {
+            uint32 reclaimed = 0;
+            uint32 size = m_buckets.Size();
+            while (m_stale_buckets > 0 && max_buckets > 0 && m_sweep_cursor < size) {
+                bucket_type * bucket = m_buckets.GetBucketByIndex(m_sweep_cursor++);
+                if (m_buckets.IsStale(bucket)) {
+                    if (bucket->Size() > 0)
+                        ++reclaimed;
+                    ReclaimBucket(bucket);
+                }
+                --max_buckets;
+            }
+
+            return reclaimed;
+        }
+
+        uint32 Size(void) const {return m_entries;}
+
+        // The count of nodes in the node pool, used or not
+        uint32 Capacity(void) const {return m_node_pool.Capacity();}
+
+        // Make room for at least entries more entries without growing on Insert,
+        // the nodes of cleared buckets are taken back before the node pool grows
+        bool Reserve(uint32 entries) {
+            ReclaimNodes(entries);
+            return m_node_pool.Reserve(entries);
+        }
+
+        // Grow the node pool in background when its free entries drop to low_watermark
+        void StartPrefill(uint32 low_watermark) {m_node_pool.StartPrefill(low_watermark);}
+        void StopPrefill(void) {m_node_pool.StopPrefill();}
+
+        // The counters of the bucket filters, collected by Find and Insert
+        const FilterStats & Stats(void) const {return m_filter_stats;}
+
+        // Call action(key, value) for every entry in this hash table
+        template <typename _Action>
+        void ForEach(_Action & action) const {
+            for (uint32 i = 0; i < m_buckets.Size(); ++i) {
+                const bucket_type * bucket = m_buckets.GetBucketByIndex(i);
+                if (m_buckets.IsStale(bucket))
+                    continue;
+
+                for (node_type * node = bucket->Head(); node; node = node->Next())
+                    action(node->Key(), node->Value());
+            }
+        }
+
+        /*
+         * @brief
+         *  Build an immutable copy of this hash table indexed by a minimal perfect
+         *  hash, see FrozenTable. This hash table is left unchanged.
+         * */
+        bool Freeze(frozen_type & frozen) const {
+            std::vector<key_type> keys;
+            std::vector<value_type> values;
+            keys.reserve(m_entries);
+            values.reserve(m_entries);
+
+            CollectEntries collect(keys, values);
+            ForEach(collect);
+
+            return frozen.Build(keys.empty() ? NULL : &keys[0], values.empty() ? NULL : &values[0], keys.size());
+        }
+
+        /*
+         * @brief
+         *  Take a consistent, read-only view of this hash table. Nothing is copied
+         *  now, buckets are copied into the snapshot only when they are written
+         *  later. The snapshot must be given back by ReleaseSnapshot.
+         * */
+        const snapshot_type * Snapshot(void) {
+            snapshot_type * snapshot = new snapshot_type(*this, ++m_snap_version, m_buckets.Epoch(), m_entries);
+            if (snapshot == NULL)
+                return NULL;
+
+            // Chain it at the front, live snapshots are ordered from the newest one
+            snapshot->m_older = m_snapshots;
+            if (m_snapshots)
+                m_snapshots->m_newer = snapshot;
+            m_snapshots = snapshot;
+
+            return snapshot;
+        }
+
+        void ReleaseSnapshot(const snapshot_type * snapshot) {
+            if (snapshot == NULL)
+                return;
+
+            snapshot_type * s = const_cast<snapshot_type *>(snapshot);
+            if (s->m_newer)
+                s->m_newer->m_older = s->m_older;
+            else
+                m_snapshots = s->m_older;
+
+            if (s->m_older)
+                s->m_older->m_newer = s->m_newer;
+
+            delete s;
+        }
+
+        void Str(ostream & os) const {
+            os << "\nHash Table Information : " << std::endl;
+            os << "** Total Entries : " << m_node_pool.Capacity() << std::endl;
+            os << "** Free  Entries : " << m_node_pool.FreeEntries() << std::endl;
+            os << "** Used  Entries : " << m_entries << std::endl;
+            os << "** Stale Buckets : " << m_stale_buckets << std::endl;
+            m_filter_stats.Str(os);
+            m_buckets.Str(os);
+        }
+
+    private:
+        friend class TableSnapshot<hash_table>;
+
+        struct CollectEntries {
+            CollectEntries(std::vector<key_type> & keys, std::vector<value_type> & values) :
+                           m_keys(keys), m_values(values) {}
+
+            void operator() (const key_type & key, const value_type & value) {
+                m_keys.push_back(key);
+                m_values.push_back(value);
+            }
+
+            std::vector<key_type>   &m_keys;
+            std::vector<value_type> &m_values;
+        };
+
+        // Copy a bucket into every live snapshot which does not have it yet, it
+        // must be called before the bucket is changed
+        void CopyOnWrite(bucket_type * bucket) {
+            if (m_snapshots == NULL || bucket->CowVersion() == m_snap_version)
+                return;
+
+            uint32 index = m_buckets.IndexOf(bucket);
+            snapshot_type * s = m_snapshots;
+            while (s && s->Version() > bucket->CowVersion()) {
+                s->Preserve(index, bucket);
+                s = s->m_older;
+            }
+
+            bucket->SetCowVersion(m_snap_version);
+        }
+
+        template <typename _K>
+        bool FindKey(const _K & key, value_type * ret) {
             node_type * node = LookupNodeByKey(key);
             if (node) {
                 if (ret) {
@@ -315,15 +798,23 @@ class hash_table {
             }
         }
 
-        bool Erase(const key_type &key, value_type * ret = NULL) {
+        template <typename _K>
+        bool EraseKey(const _K & key, value_type * ret) {
             // Compute signature and get bucket
             sig_t sig = m_hash_func(key);
-            bucket_type * bucket = m_buckets.GetBucketBySig(sig);
+            bucket_type * bucket = GetBucket(sig);
 
             // Remove this node from bucket
             if (bucket) { 
+                if (m_snapshots && bucket->Lookup(sig, key))
+                    CopyOnWrite(bucket);
+
                 node_type * node = bucket->Remove(sig, key);
                 if (node) {
+                    if (bucket->Size() == 0)
+                        --m_used_buckets;
+                    --m_entries;
+
                     // Put this node to free node list
                     m_node_pool.PutNode(node);
 #ifdef DEBUG
@@ -342,35 +833,20 @@ class hash_table {
             return false;
         }
 
-        // Update the value
-        template <typename _Modifier>
-        bool Update(const key_type & key, value_type new_value, _Modifier &update) {
-            node_type * node = LookupNodeByKey(key);
+        template <typename _K, typename _Modifier>
+        bool UpdateKey(const _K & key, value_type new_value, _Modifier &update) {
+            sig_t sig = m_hash_func(key);
+            bucket_type * bucket = GetBucket(sig);
+            node_type * node = bucket ? bucket->Lookup(sig, key) : NULL;
             if (node) {
+                CopyOnWrite(bucket);
                 node->Update(new_value, update); 
+                return true;
             } else {
                 return false;
             }
         }
 
-        // Clear this hash table
-        void Clear(void) {
-            for (int i = 0; i < m_buckets.Size(); ++i) {
-                PutBucketToFreeList(m_buckets.GetBucketByIndex(i));
-            }
-#ifdef DEBUG
-            m_node_pool.Print();
-#endif
-        }
-
-        void Str(ostream & os) const {
-            os << "\nHash Table Information : " << std::endl;
-            os << "** Total Entries : " << m_node_pool.Capacity() << std::endl;
-            os << "** Free  Entries : " << m_node_pool.FreeEntries() << std::endl;
-            m_buckets.Str(os);
-        }
-
-    private:
         template <typename _Action>
         void TravelNodeList(node_type * head, _Action action, ostream &os) const {
             if (head == NULL)
@@ -395,7 +871,7 @@ class hash_table {
             // Put nodes to m_node_pool
             m_node_pool.PutNodeList(start, end, bucket->Size());
 
-            // Now it is time to clear bucket
+            // Now it is time to clear bucket, the tail pointer spares us a walk
             bucket->Clear();
 
 #ifdef DEBUG
@@ -406,18 +882,47 @@ class hash_table {
 #endif
         }
 
-        node_type * LookupNodeByKey(const key_type & key) {
-            node_type * ret = NULL;
+        // Give the nodes of a stale bucket back and move it to current epoch
+        void ReclaimBucket(bucket_type * bucket) {
+            if (bucket->Size() > 0) {
+                --m_stale_buckets;
+                CopyOnWrite(bucket);
+            }
 
-            // Compute signature and get bucket
-            sig_t sig = m_hash_func(key);
+            PutBucketToFreeList(bucket);
+            bucket->SetEpoch(m_buckets.Epoch());
+        }
+
+        // Sweep stale buckets until the node pool has wanted free nodes, or
+        // until no stale bucket is left
+        void ReclaimNodes(uint32 wanted) {
+            uint32 size = m_buckets.Size();
+            while (m_stale_buckets > 0 && m_node_pool.FreeEntries() < wanted && m_sweep_cursor < size) {
+                bucket_type * bucket = m_buckets.GetBucketByIndex(m_sweep_cursor++);
+                if (m_buckets.IsStale(bucket))
+                    ReclaimBucket(bucket);
+            }
+        }
+
+        // Get the bucket of a signature, reclaiming it first if it is stale
+        bucket_type * GetBucket(sig_t sig) {
             bucket_type * bucket = m_buckets.GetBucketBySig(sig);
+            if (bucket && m_buckets.IsStale(bucket))
+                ReclaimBucket(bucket);
 
-            // Search in this bucket
-            if (bucket)
-                return bucket->Lookup(sig, key); 
-            else
+            return bucket;
+        }
+
+        template <typename _K>
+        node_type * LookupNodeByKey(const _K & key) {
+            // Compute signature and get bucket
+            sig_t sig = m_hash_func(key);
+            bucket_type * bucket = GetBucket(sig);
+            if (bucket == NULL)
                 return NULL;
+
+            // Search in this bucket, most misses are rejected by its filter
+            return bucket->Lookup(sig, key, &m_filter_stats);
         }
 
         void PrintBucketList(const bucket_type &bucket) const {
@@ -432,6 +937,13 @@ class hash_table {
         hasher         m_hash_func;
         node_pool_type m_node_pool;
         bucket_mgr     m_buckets;
+        uint32         m_entries;       // the count of entries in current epoch
+        uint32         m_used_buckets;  // non-empty buckets in current epoch
+        uint32         m_stale_buckets; // non-empty buckets left by Clear, not reclaimed yet
+        uint32         m_sweep_cursor;  // where Sweep goes on
+        snapshot_type *m_snapshots;     // the newest live snapshot
+        uint32         m_snap_version;  // the version of the latest snapshot
+        FilterStats    m_filter_stats;
 };
 
 __SHM_STL_END
@@ -0,0 +1,220 @@
+#ifndef __SNAPSHOT_H_
+#define __SNAPSHOT_H_
+
+#include <sys/types.h>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <type_traits>
+#include "hash_fun.h"
+#include "common.h"
+#include "bucket.h"
+
+using std::ostream;
+
+__SHM_STL_BEGIN
+
+/*
+ * @brief : TableSnapshot is a read-only, point-in-time view of a hash_table. It is
+ *          created by hash_table::Snapshot and must be given back by
+ *          hash_table::ReleaseSnapshot before the table is destroyed.
+ *
+ *          Taking a snapshot copies nothing. Instead, every bucket remembers the
+ *          latest snapshot it was copied for. Before a writer changes a bucket
+ *          which is older than some live snapshots, the hash table copies the
+ *          chain of that bucket into those snapshots. A snapshot reads a bucket
+ *          from its own copy if there is one, otherwise from the table itself,
+ *          since that bucket is unchanged since the snapshot was taken. So the
+ *          memory used by a snapshot only grows with the buckets written while
+ *          it is alive.
+ *
+ *          A snapshot shares the buckets not written yet with the table, and even
+ *          a lookup on the table reorders a chain. So each call on a snapshot
+ *          must be serialized with calls on its table, just as calls on the table
+ *          itself are. A long export does not need to hold writers off for the
+ *          whole scan though: ForEach can scan a slice of buckets at a time and
+ *          resume from where it stopped, and writers run between the slices.
+ *          The view stays the one of the moment the snapshot was taken.
+ *
+ *          Following is a chart to illustrate this class:
+ *
+ *          snapshot (version 2) --> m_preserved : { 3 -> [<k, v>, <k, v>] }
+ *                                                   |
+ *          bucket array --> [0] [1] [2] [3] [4] ... |
+ *                            ^   ^   ^   ^----------+ [bucket 3 is written after snapshot 2]
+ *                            |   |   |
+ *                            +---+---+--- [read from the table directly]
+ *
+ * */
+template <typename _Table>
+class TableSnapshot {
+    public:
+        typedef typename _Table::key_type    key_type;
+        typedef typename _Table::value_type  value_type;
+        typedef typename _Table::bucket_type bucket_type;
+        typedef typename _Table::node_type   node_type;
+
+        struct Entry {
+            key_type   m_key;
+            value_type m_value;
+            sig_t      m_sig;
+        };
+
+        typedef std::vector<Entry> chain_type;
+        typedef std::map<uint32, chain_type> chain_map;
+
+        uint32 Version(void) const {return m_version;}
+        uint32 Size(void) const {return m_size;}
+        uint32 PreservedBuckets(void) const {return m_preserved.size();}
+
+        /*
+         * @brief
+         *  Find a key as it was when this snapshot was taken
+         *  ret is an output parameter to take the value if the key is found
+         * */
+        bool Find(const key_type & key, value_type * ret = NULL) const {
+            return FindKey(key, ret);
+        }
+
+        // Find by any type comparable to key_type, see hash_table::Find
+        template <typename _K>
+        typename std::enable_if<transparent_lookup<typename _Table::hasher, typename _Table::key_equal, key_type, _K>::value, bool>::type
+        Find(const _K & key, value_type * ret = NULL) const {
+            return FindKey(key, ret);
+        }
+
+        // Call action(key, value) for every entry in this snapshot
+        template <typename _Action>
+        void ForEach(_Action & action) const {
+            ForEach(action, 0, Buckets());
+        }
+
+        /*
+         * @brief
+         *  Call action(key, value) for the entries of at most max_buckets buckets,
+         *  starting from start_bucket. It returns the bucket to start from next
+         *  time, which is Buckets() once the scan is done. An exporter scans in
+         *  slices and lets writers run between them:
+         *
+         *  uint32 next = 0;
+         *  while (next < snapshot->Buckets()) {
+         *      lock table;
+         *      next = snapshot->ForEach(action, next, 64);
+         *      unlock table;
+         *  }
+         * */
+        template <typename _Action>
+        uint32 ForEach(_Action & action, uint32 start_bucket, uint32 max_buckets) const {
+            uint32 size = Buckets();
+            if (start_bucket >= size)
+                return size;
+
+            uint32 end = (max_buckets < size - start_bucket) ? start_bucket + max_buckets : size;
+
+            typename chain_map::const_iterator it = m_preserved.lower_bound(start_bucket);
+            for (uint32 i = start_bucket; i < end; ++i) {
+                if (it != m_preserved.end() && it->first == i) {
+                    const chain_type & chain = it->second;
+                    for (typename chain_type::const_iterator e = chain.begin(); e != chain.end(); ++e)
+                        action(e->m_key, e->m_value);
+                    ++it;
+                    continue;
+                }
+
+                const bucket_type * bucket = m_table.m_buckets.GetBucketByIndex(i);
+                if (bucket->Epoch() != m_epoch)
+                    continue;
+
+                for (node_type * node = bucket->Head(); node; node = node->Next())
+                    action(node->Key(), node->Value());
+            }
+
+            return end;
+        }
+
+        // The count of buckets a scan by ForEach goes through
+        uint32 Buckets(void) const {return m_table.m_buckets.Size();}
+
+        void Str(ostream & os) const {
+            os << "\nSnapshot Information : " << std::endl;
+            os << "** Version           : " << m_version << std::endl;
+            os << "** Entries           : " << m_size << std::endl;
+            os << "** Preserved Buckets : " << m_preserved.size() << std::endl;
+        }
+
+    private:
+        template <typename _K>
+        bool FindKey(const _K & key, value_type * ret) const {
+            sig_t sig = m_table.m_hash_func(key);
+            const bucket_type * bucket = m_table.m_buckets.GetBucketBySig(sig);
+            if (bucket == NULL)
+                return false;
+
+            typename chain_map::const_iterator it = m_preserved.find(m_table.m_buckets.IndexOf(bucket));
+            if (it != m_preserved.end()) {
+                const chain_type & chain = it->second;
+                for (typename chain_type::const_iterator e = chain.begin(); e != chain.end(); ++e) {
+                    if (sig == e->m_sig && m_equal_to(key, e->m_key)) {
+                        if (ret)
+                            *ret = e->m_value;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // This bucket is not written since the snapshot
+            if (bucket->Epoch() != m_epoch)
+                return false;
+
+            node_type * node = bucket->Search(sig, key);
+            if (node == NULL)
+                return false;
+
+            if (ret)
+                *ret = node->Value();
+            return true;
+        }
+
+        friend _Table;
+
+        TableSnapshot(const _Table & table, uint32 version, uint32 epoch, uint32 size) :
+                      m_table(table), m_version(version), m_epoch(epoch), m_size(size),
+                      m_newer(NULL), m_older(NULL) {}
+
+        // Not copyable, a snapshot is owned by its table
+        TableSnapshot(const TableSnapshot &);
+        TableSnapshot & operator= (const TableSnapshot &);
+
+        // Copy a bucket before the table changes it
+        void Preserve(uint32 index, const bucket_type * bucket) {
+            chain_type & chain = m_preserved[index];
+
+            // A bucket of an older epoch is empty in this snapshot
+            if (bucket->Epoch() != m_epoch)
+                return;
+
+            chain.reserve(bucket->Size());
+            for (node_type * node = bucket->Head(); node; node = node->Next()) {
+                Entry entry;
+                entry.m_key   = node->Key();
+                entry.m_value = node->Value();
+                entry.m_sig   = node->Signature();
+                chain.push_back(entry);
+            }
+        }
+
+    private:
+        const _Table  &m_table;
+        uint32         m_version;   // snapshots taken later have greater versions
+        uint32         m_epoch;     // the bucket epoch when this snapshot was taken
+        uint32         m_size;      // the count of entries in this snapshot
+        TableSnapshot *m_newer;     // live snapshots are chained from the newest one
+        TableSnapshot *m_older;
+        chain_map      m_preserved; // buckets written after this snapshot, by bucket index
+        typename _Table::key_equal m_equal_to;
+};
+
+__SHM_STL_END
+
+#endif
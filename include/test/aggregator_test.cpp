@@ -0,0 +1,70 @@
+#include <iostream>
+#include "hash_table.h"
+
+using namespace std;
+using shm_stl::hash_table;
+using shm_stl::Aggregator;
+
+typedef hash_table<int, long> table_type;
+typedef Aggregator<table_type> aggregator_type;
+
+struct Total {
+    Total() : m_keys(0), m_sum(0) {}
+
+    void operator() (const int &, const long & value) {
+        ++m_keys;
+        m_sum += value;
+    }
+
+    int  m_keys;
+    long m_sum;
+};
+
+/*
+ * The shared table holds 62 nodes and a Local table 496 nodes, so of 1000
+ * distinct keys some wait in the Local table and the last ones are dropped
+ * */
+int main(void) {
+    table_type shared(2, 8);
+    aggregator_type aggregator(shared, 16);
+    aggregator_type::Local local(aggregator);
+
+    int shared_full = 0;
+    int dropped = 0;
+    for (int i = 0; i < 1000; ++i) {
+        aggregator_type::UpdateResult result = local.Update(i, 1);
+        if (result == aggregator_type::UPDATE_SHARED_FULL)
+            ++shared_full;
+        else if (result == aggregator_type::UPDATE_DROPPED)
+            ++dropped;
+    }
+
+    Total total;
+    aggregator.ForEach(total);
+    cout << "Shared keys : " << total.m_keys << ", local keys : " << local.Size()
+         << ", shared full : " << shared_full << ", dropped : " << dropped << endl;
+
+    if (shared_full == 0) {
+        cout << "Update should report the shared table is full!" << endl;
+        return 1;
+    }
+
+    if (dropped == 0) {
+        cout << "Update should report the deltas which fit nowhere!" << endl;
+        return 1;
+    }
+
+    // Every delta not reported as dropped is in one of the tables
+    if (total.m_sum + local.Size() != 1000 - dropped) {
+        cout << "Aggregator lost deltas when the shared table is full!" << endl;
+        return 1;
+    }
+
+    if (local.Flush()) {
+        cout << "Flush should fail when the shared table is full!" << endl;
+        return 1;
+    }
+
+    cout << "Aggregator keeps every delta it does not report as dropped" << endl;
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <iostream>
+#include "hash_table.h"
+
+using namespace std;
+using shm_stl::hash_table;
+
+typedef hash_table<int, int> table_type;
+
+// Refill a table after every Clear, the nodes of the cleared entries must be reused
+int main(void) {
+    const int entries = 6000;
+    table_type table(8192, 1 << 16);
+
+    unsigned int capacity = 0;
+    for (int round = 0; round < 4; ++round) {
+        int base = round * 100000;
+        for (int i = 0; i < entries; ++i) {
+            if (!table.Insert(base + i, i)) {
+                cout << "Insert failed in round " << round << endl;
+                return 1;
+            }
+        }
+
+        if (round == 0)
+            capacity = table.Capacity();
+
+        if (table.Size() != entries || table.Capacity() != capacity) {
+            cout << "Round " << round << " : size " << table.Size()
+                 << ", capacity " << table.Capacity() << ", expected " << capacity << endl;
+            return 1;
+        }
+
+        // The keys of the last round are gone
+        for (int i = 0; round > 0 && i < entries; ++i) {
+            if (table.Find(base - 100000 + i)) {
+                cout << "Key " << base - 100000 + i << " survived Clear!" << endl;
+                return 1;
+            }
+        }
+
+        int value = -1;
+        if (!table.Find(base + entries - 1, &value) || value != entries - 1) {
+            cout << "Key " << base + entries - 1 << " is lost!" << endl;
+            return 1;
+        }
+
+        table.Clear();
+        if (table.Size() != 0) {
+            cout << "Size is " << table.Size() << " after Clear!" << endl;
+            return 1;
+        }
+    }
+
+    cout << "Refilled " << entries << " entries after each Clear, capacity stays " << capacity << endl;
+    return 0;
+}
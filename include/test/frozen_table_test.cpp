@@ -0,0 +1,154 @@
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <memory.h>
+#include "hash_table.h"
+
+using namespace std;
+using shm_stl::FrozenTable;
+using shm_stl::FrozenHeader;
+using shm_stl::uint32;
+using shm_stl::uint64;
+
+typedef FrozenTable<int, int> frozen_type;
+
+const int ENTRIES = 10000;
+
+// Keys are 7 * i + 3, every other number below 7 * ENTRIES is a miss
+bool CheckTable(const frozen_type & table, const char * name) {
+    if (table.Size() != ENTRIES) {
+        cout << name << " : size is " << table.Size() << endl;
+        return false;
+    }
+
+    for (int key = -7; key < 7 * ENTRIES + 7; ++key) {
+        int value = -1;
+        bool expected = key >= 0 && key < 7 * ENTRIES && key % 7 == 3;
+        bool found = table.Find(key, &value);
+        if (found != expected || (found && value != key / 7)) {
+            cout << name << " : Find(" << key << ") is wrong!" << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ReadFile(const char * path, vector<char> & data) {
+    FILE * fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+
+    char buffer[4096];
+    size_t n;
+    data.clear();
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        data.insert(data.end(), buffer, buffer + n);
+
+    fclose(fp);
+    return true;
+}
+
+bool WriteFile(const char * path, const vector<char> & data, size_t size) {
+    FILE * fp = fopen(path, "wb");
+    if (fp == NULL)
+        return false;
+
+    bool ok = fwrite(&data[0], 1, size, fp) == size;
+    return fclose(fp) == 0 && ok;
+}
+
+// Write a damaged copy of a saved table, Load must refuse it
+bool CheckRejected(const vector<char> & data, size_t size, const char * path, const char * name) {
+    frozen_type table;
+    if (!WriteFile(path, data, size) || table.Load(path)) {
+        cout << "A table with " << name << " is loaded!" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+template <typename _Tp>
+void Poke(vector<char> & data, size_t offset, _Tp value) {
+    memcpy(&data[offset], &value, sizeof(value));
+}
+
+template <typename _Tp>
+_Tp Peek(const vector<char> & data, size_t offset) {
+    _Tp value;
+    memcpy(&value, &data[offset], sizeof(value));
+    return value;
+}
+
+int main(void) {
+    vector<int> keys, values;
+    for (int i = 0; i < ENTRIES; ++i) {
+        keys.push_back(7 * i + 3);
+        values.push_back(i);
+    }
+
+    frozen_type table;
+    if (!table.Build(&keys[0], &values[0], ENTRIES) || !CheckTable(table, "Built table"))
+        return 1;
+
+    frozen_type empty;
+    if (!empty.Build(NULL, NULL, 0) || empty.Size() != 0 || empty.Find(3)) {
+        cout << "Empty table is wrong!" << endl;
+        return 1;
+    }
+
+    char path[64], bad_path[64];
+    snprintf(path, sizeof(path), "/tmp/frozen_table_test.%d", getpid());
+    snprintf(bad_path, sizeof(bad_path), "/tmp/frozen_table_test.%d.bad", getpid());
+
+    frozen_type loaded, loaded_empty;
+    bool ok = table.Save(path) && loaded.Load(path) && CheckTable(loaded, "Loaded table");
+    ok = ok && empty.Save(bad_path) && loaded_empty.Load(bad_path) && loaded_empty.Size() == 0 && !loaded_empty.Find(3);
+    if (!ok) {
+        cout << "Save and Load lost the table!" << endl;
+        unlink(path);
+        unlink(bad_path);
+        return 1;
+    }
+
+    vector<char> good;
+    ReadFile(path, good);
+
+    uint64 remap_offset = Peek<uint64>(good, offsetof(FrozenHeader, m_remap_offset));
+    uint32 remapped = Peek<uint32>(good, offsetof(FrozenHeader, m_slots)) - ENTRIES;
+
+    vector<char> bad = good;
+    ok = CheckRejected(bad, sizeof(FrozenHeader) - 1, bad_path, "a truncated header");
+    ok = ok && CheckRejected(bad, bad.size() - 1, bad_path, "a truncated entry array");
+
+    bad = good;
+    bad[0] = 'X';
+    ok = ok && CheckRejected(bad, bad.size(), bad_path, "a wrong magic");
+
+    bad = good;
+    Poke<uint64>(bad, offsetof(FrozenHeader, m_pilot_offset), uint64(1) << 40);
+    ok = ok && CheckRejected(bad, bad.size(), bad_path, "a pilot offset out of the file");
+
+    bad = good;
+    Poke<uint64>(bad, offsetof(FrozenHeader, m_pilot_offset), sizeof(FrozenHeader) + 1);
+    ok = ok && CheckRejected(bad, bad.size(), bad_path, "a misaligned pilot array");
+
+    bad = good;
+    Poke<uint64>(bad, offsetof(FrozenHeader, m_remap_offset), sizeof(FrozenHeader));
+    ok = ok && CheckRejected(bad, bad.size(), bad_path, "overlapped pilot and remap arrays");
+
+    bad = good;
+    Poke<uint32>(bad, remap_offset + (remapped - 1) * sizeof(uint32), ENTRIES);
+    ok = ok && remapped > 0 && CheckRejected(bad, bad.size(), bad_path, "a remap entry out of the table");
+
+    unlink(path);
+    unlink(bad_path);
+    if (!ok)
+        return 1;
+
+    cout << "Frozen table of " << ENTRIES << " entries is built, saved, loaded and checked" << endl;
+    return 0;
+}
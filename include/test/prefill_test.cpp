@@ -0,0 +1,86 @@
+#include <iostream>
+#include "hash_table.h"
+
+using namespace std;
+using shm_stl::hash_table;
+
+typedef hash_table<int, int> table_type;
+
+bool CheckKeys(table_type & table, int base, int entries, const char * name) {
+    for (int i = 0; i < entries; ++i) {
+        int value = -1;
+        if (!table.Find(base + i, &value) || value != i) {
+            cout << name << " : key " << base + i << " is lost!" << endl;
+            return false;
+        }
+    }
+
+    if (table.Size() != (unsigned int)entries) {
+        cout << name << " : size is " << table.Size() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+int main(void) {
+    // The first free list has 16 nodes, 450 entries need five lists
+    table_type table(16, 64);
+    table.StartPrefill(8);
+    for (int i = 0; i < 450; ++i) {
+        if (!table.Insert(i, i)) {
+            cout << "Insert " << i << " failed with prefill!" << endl;
+            return 1;
+        }
+    }
+    table.StopPrefill();
+
+    if (table.Capacity() < 450 || !CheckKeys(table, 0, 450, "Prefilled table"))
+        return 1;
+
+    // The pool can not grow past its last free list
+    if (table.Reserve(table.Capacity() * 4)) {
+        cout << "Reserve should fail beyond the last free list!" << endl;
+        return 1;
+    }
+
+    // 200 entries need four lists, 240 nodes. After Clear the cleared nodes
+    // are enough, neither Reserve nor prefill may grow the pool. The new keys
+    // fall in other buckets, so only sweeping brings the cleared nodes back
+    table_type refill(16, 4096);
+    refill.StartPrefill(8);
+    for (int i = 0; i < 200; ++i)
+        refill.Insert(i, i);
+    refill.StopPrefill();
+
+    unsigned int capacity = refill.Capacity();
+    refill.Clear();
+    refill.StartPrefill(8);
+    for (int i = 0; i < 200; ++i)
+        refill.Insert(1000 + i, i);
+    refill.StopPrefill();
+
+    if (refill.Capacity() != capacity) {
+        cout << "Prefill grew the pool from " << capacity << " to " << refill.Capacity() << endl;
+        return 1;
+    }
+
+    if (!CheckKeys(refill, 1000, 200, "Refilled table"))
+        return 1;
+
+    refill.Clear();
+    if (!refill.Reserve(200) || refill.Capacity() != capacity) {
+        cout << "Reserve grew the pool from " << capacity << " to " << refill.Capacity() << endl;
+        return 1;
+    }
+
+    // Reserve grows a new table ahead of time
+    table_type reserved(16, 64);
+    if (!reserved.Reserve(200) || reserved.Capacity() < 200) {
+        cout << "Reserve did not grow the pool!" << endl;
+        return 1;
+    }
+
+    cout << "Prefill grew the pool to " << table.Capacity() << " nodes and every key is found" << endl;
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <map>
+#include "hash_table.h"
+
+using namespace std;
+using shm_stl::hash_table;
+using shm_stl::Assignment;
+
+typedef hash_table<int, int> table_type;
+typedef table_type::snapshot_type snapshot_type;
+typedef map<int, int> content_type;
+
+struct Collect {
+    Collect(content_type & content) : m_content(content), m_duplicates(0) {}
+
+    void operator() (const int & key, const int & value) {
+        if (!m_content.insert(make_pair(key, value)).second)
+            ++m_duplicates;
+    }
+
+    content_type &m_content;
+    int           m_duplicates;
+};
+
+// Check a snapshot by Find, keys from 0 to 399 not in expected must be missing
+bool CheckFind(const snapshot_type * snapshot, const content_type & expected, const char * name) {
+    for (int key = 0; key < 400; ++key) {
+        int value = -1;
+        content_type::const_iterator it = expected.find(key);
+        bool found = snapshot->Find(key, &value);
+        if (found != (it != expected.end()) || (found && value != it->second)) {
+            cout << name << " : Find(" << key << ") is wrong!" << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Scan a snapshot 3 buckets at a time and write to the table between the slices
+bool CheckScan(table_type & table, const snapshot_type * snapshot, const content_type & expected,
+               const char * name, int next_key) {
+    content_type content;
+    Collect collect(content);
+    unsigned int next = 0;
+    while (next < snapshot->Buckets()) {
+        next = snapshot->ForEach(collect, next, 3);
+        table.Insert(next_key++, 0);
+        table.Erase(next_key - 2);
+        table.Sweep(2);
+    }
+
+    if (content != expected || collect.m_duplicates != 0) {
+        cout << name << " : ForEach found " << content.size() << " entries, expected "
+             << expected.size() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+int main(void) {
+    table_type table(64, 16);
+    Assignment<int> assign;
+
+    content_type first;
+    for (int i = 0; i < 100; ++i) {
+        table.Insert(i, i);
+        first[i] = i;
+    }
+
+    const snapshot_type * s1 = table.Snapshot();
+
+    content_type second = first;
+    for (int i = 0; i < 10; ++i) {
+        table.Erase(i);
+        second.erase(i);
+    }
+    for (int i = 100; i < 110; ++i) {
+        table.Insert(i, i);
+        second[i] = i;
+    }
+    for (int i = 10; i < 20; ++i) {
+        table.Update(i, i + 1000, assign);
+        second[i] = i + 1000;
+    }
+
+    const snapshot_type * s2 = table.Snapshot();
+
+    // The cleared buckets are reclaimed lazily, partly by Sweep and partly by Insert
+    table.Clear();
+    table.Sweep(4);
+    for (int i = 200; i < 205; ++i)
+        table.Insert(i, i);
+
+    if (s1->Size() != first.size() || s2->Size() != second.size()) {
+        cout << "Snapshot sizes are wrong!" << endl;
+        return 1;
+    }
+
+    if (!CheckFind(s1, first, "Snapshot 1") || !CheckFind(s2, second, "Snapshot 2"))
+        return 1;
+
+    // Release the older snapshot first, the newer one must not notice
+    if (!CheckScan(table, s1, first, "Snapshot 1", 300))
+        return 1;
+    table.ReleaseSnapshot(s1);
+
+    table.Sweep(1024);
+    if (!CheckFind(s2, second, "Snapshot 2") || !CheckScan(table, s2, second, "Snapshot 2", 350))
+        return 1;
+    table.ReleaseSnapshot(s2);
+
+    cout << "Snapshots keep their contents across Erase, Insert, Update, Clear and Sweep" << endl;
+    return 0;
+}